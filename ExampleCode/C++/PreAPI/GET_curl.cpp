@@ -1,5 +1,9 @@
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <curl/curl.h>                  //CURL to make HTTP requests
 #include "../../../../picojson.h"        // May need to change the path for this if not in git repo
 
@@ -25,20 +29,38 @@ const string devURL = "http://rsense-dev.cs.uml.edu/api/v1/projects/";
     3. The field IDs, followed by their type (i.e. number/text/etc)
 */
 
+// Largest body the header callback will allocate up front. Bigger responses
+// still work, the buffer just grows to fit them as the data comes in.
+const size_t memf_max_presize = 64 * 1024 * 1024;
+
 // This is from the picojson example page
 // I use it to save the JSON from iSENSE to memory (temporary)
+// The buffer grows geometrically and keeps one spare byte for a '\0', so the
+// response can be used as a C string without copying it again.
 typedef struct {
-    char* data;       // response data from server
+    char* data;         // response data from server
     size_t size;        // response size of data
+    size_t capacity;    // bytes allocated for data (always more than size)
 } MEMFILE;
 
 MEMFILE*  memfopen() {
     MEMFILE* mf = (MEMFILE*) malloc(sizeof(MEMFILE));
     mf->data = NULL;
     mf->size = 0;
+    mf->capacity = 0;
     return mf;
 }
 
+// Empties the memfile but keeps its buffer, so it can be reused for another request.
+void memfreset(MEMFILE* mf) {
+    mf->size = 0;
+
+    if (mf->data)
+    {
+        mf->data[0] = 0;
+    }
+}
+
 void memfclose(MEMFILE* mf) {
     // Double check to make sure that mf exists.
     if(mf == NULL)
@@ -56,35 +78,118 @@ void memfclose(MEMFILE* mf) {
     free(mf);
 }
 
-size_t memfwrite(char* ptr, size_t size, size_t nmemb, void* stream) {
-    MEMFILE* mf = (MEMFILE*) stream;
-    int block = size * nmemb;
+// Makes sure the memfile can hold "total" bytes (plus the '\0') without reallocating.
+// Returns false if we ran out of memory, in which case the old data is left alone.
+bool memfreserve(MEMFILE* mf, size_t total) {
+    if (total < mf->capacity)
+    {
+        return true;
+    }
 
-    if (!mf->data)
+    // No room left for the '\0' - realloc(data, 0) would free the buffer.
+    if (total == SIZE_MAX)
     {
-        mf->data = (char*) malloc(block);
+        return false;
     }
-    else
+
+    char* data = (char*) realloc(mf->data, total + 1);
+
+    if (!data)
     {
-        mf->data = (char*) realloc(mf->data, mf->size + block);
+        return false;
     }
 
-    if (mf->data)
+    mf->data = data;
+    mf->capacity = total + 1;
+    return true;
+}
+
+size_t memfwrite(char* ptr, size_t size, size_t nmemb, void* stream) {
+    MEMFILE* mf = (MEMFILE*) stream;
+    size_t block = size * nmemb;
+    size_t needed = mf->size + block;
+
+    // Grow by doubling instead of by the chunk size, so a large response
+    // is not copied over and over again as it comes in.
+    if (needed >= mf->capacity)
     {
-        memcpy(mf->data + mf->size, ptr, block);
-        mf->size += block;
+        size_t grow = mf->capacity * 2;
+
+        if (grow < 4096)
+        {
+            grow = 4096;
+        }
+
+        if ((grow <= needed || !memfreserve(mf, grow)) && !memfreserve(mf, needed))
+        {
+            // Returning less than we were given tells cURL to stop the transfer.
+            return 0;
+        }
     }
 
+    memcpy(mf->data + mf->size, ptr, block);
+    mf->size += block;
+    mf->data[mf->size] = 0;
+
     return block;
 }
 
-char* memfstrdup(MEMFILE* mf)
-{
-    char* buf = (char*)malloc(mf->size + 1);
-    memcpy(buf, mf->data, mf->size);
-    buf[mf->size] = 0;
+// Header callback - if the server tells us how big the response is,
+// allocate the whole thing up front instead of growing the buffer as we go.
+size_t memfheader(char* ptr, size_t size, size_t nmemb, void* stream) {
+    MEMFILE* mf = (MEMFILE*) stream;
+    size_t length = size * nmemb;
+    const char name[] = "content-length:";
+    size_t name_length = sizeof(name) - 1;
+
+    if (length > name_length)
+    {
+        size_t i;
+
+        for (i = 0; i < name_length; i++)
+        {
+            if (tolower((unsigned char) ptr[i]) != name[i])
+            {
+                return length;
+            }
+        }
 
-    return buf;
+        // The header line is not null terminated, so read the digits by hand.
+        size_t content_length = 0;
+
+        for (; i < length; i++)
+        {
+            if (ptr[i] >= '0' && ptr[i] <= '9')
+            {
+                // Too many digits to be a real length, ignore the header.
+                if (content_length > (SIZE_MAX - '9') / 10)
+                {
+                    return length;
+                }
+
+                content_length = content_length * 10 + (ptr[i] - '0');
+            }
+            else if (ptr[i] != ' ' && ptr[i] != '\t')
+            {
+                break;
+            }
+        }
+
+        // Don't trust a huge Content-Length with an allocation, leave that to memfwrite.
+        // Not being able to presize is fine, memfwrite will grow the buffer instead.
+        if (content_length <= memf_max_presize)
+        {
+            memfreserve(mf, mf->size + content_length);
+        }
+    }
+
+    return length;
+}
+
+// The data is always null terminated, so it can be used as a string directly.
+const char* memfstr(MEMFILE* mf)
+{
+    return mf->data ? mf->data : "";
 }
 
 
@@ -115,6 +220,15 @@ int main()
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, memfwrite);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, json_file);
 
+        // Presize the memfile from the Content-Length header when the server sends one.
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, memfheader);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, json_file);
+
+        // Ask for a compressed response. An empty string means any encoding this cURL
+        // supports, and cURL inflates it as it arrives, so memfwrite only sees plain JSON.
+        // (Content-Length is then the compressed size, memfwrite grows the buffer from there.)
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
         // Perform the request, res will get the return code
         res = curl_easy_perform(curl);
 
@@ -219,7 +333,7 @@ int main()
 
     // Clean up cURL and close the memfile
     curl_easy_cleanup(curl);
-    curl_easy_init();
+    memfclose(json_file);
 
     return 0;
 }
\ No newline at end of file